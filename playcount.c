@@ -6,16 +6,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include <deadbeef.h>
 
 #include "id3v2.h"
+#include "records.h"
+#include "scan.h"
 
 #define trace(...) { fprintf(stderr, __VA_ARGS__); }
 #define UNUSED(x) { (void) x; }
 
 static DB_functions_t *deadbeef;
 
+// Serializes play count updates (meta and tag together), which may come from
+// both the main thread (playback) and an import.
+static uintptr_t tag_write_mutex;
+
 static const char *PLAY_COUNT_META = "play_count";
 
 static const char *LOCATION_TAG = ":URI";
@@ -95,6 +102,8 @@ static uintmax_t get_track_tag_playcount(DB_playItem_t *track) {
     // If the frame exists read its count.
     DB_id3v2_tag_t id3v2 = {0};
     DB_FILE *track_file = deadbeef->fopen(track_location);
+    if (!track_file) { return 0; }
+
     deadbeef->junk_id3v2_read_full(track, &id3v2, track_file);
 
     uintmax_t count = 0;
@@ -108,23 +117,23 @@ static uintmax_t get_track_tag_playcount(DB_playItem_t *track) {
 }
 
 /**
- * Write the given play count to the track's tag.
+ * Write the given play count to the tag of the track at the given location.
  *
  * Creates the PCNT frame if one does not already exist.
  *
  * @param track  A pointer to the track.
+ * @param track_location  The track's location.
  * @param count  The play count to set.
  * @return  A positive integer if an error occurred, zero otherwise.
  */
-static uint8_t set_track_tag_playcount(DB_playItem_t *track, uintmax_t count) {
-
-    deadbeef->pl_lock();
-    const char *track_location = deadbeef->pl_find_meta(track, LOCATION_TAG);
-    deadbeef->pl_unlock();
+static uint8_t write_track_tag_playcount(
+        DB_playItem_t *track, const char *track_location, uintmax_t count) {
 
     // Create the frame if it doesn't exist. Either way set its count.
     DB_id3v2_tag_t id3v2 = {0};
     DB_FILE *track_file = deadbeef->fopen(track_location);
+    if (!track_file) { return 1; }
+
     deadbeef->junk_id3v2_read_full(track, &id3v2, track_file);
 
     DB_id3v2_frame_t *pcnt = id3v2_tag_get_pcnt_frame(&id3v2);
@@ -150,24 +159,42 @@ static uint8_t set_track_tag_playcount(DB_playItem_t *track, uintmax_t count) {
     }
 
     // Save the changes.
+    uint8_t failed = 1;
     FILE *actual_file = fopen(track_location, "r+");
-    deadbeef->junk_id3v2_write(actual_file, &id3v2);
-    fclose(actual_file);
+
+    if (actual_file) {
+        failed = deadbeef->junk_id3v2_write(actual_file, &id3v2) != 0;
+        if (fclose(actual_file)) { failed = 1; }
+    }
 
     // Clean up resources.
     if (created) { free(id3v2_tag_rem_pcnt_frame(&id3v2)); }
     deadbeef->junk_id3v2_free(&id3v2);
     deadbeef->fclose(track_file);
 
-    return 0;
+    return failed;
+}
+
+/**
+ * Write the given play count to the track's tag.
+ *
+ * @param track  A pointer to the track.
+ * @param count  The play count to set.
+ * @return  A positive integer if an error occurred, zero otherwise.
+ */
+static uint8_t set_track_tag_playcount(DB_playItem_t *track, uintmax_t count) {
+
+    deadbeef->pl_lock();
+    const char *track_location = deadbeef->pl_find_meta(track, LOCATION_TAG);
+    deadbeef->pl_unlock();
+
+    return write_track_tag_playcount(track, track_location, count);
 }
 
 //
 //  Interoperability (meta play_count <---> tag pcnt)
 //
-static void load_tag_to_meta(DB_playItem_t *track) {
-    uintmax_t count = get_track_tag_playcount(track);
-
+static void load_count_to_meta(DB_playItem_t *track, uintmax_t count) {
     if (count > INT_MAX) {
 #ifdef DEBUG
         trace("playcount: tag count is larger than can be displayed\n")
@@ -177,13 +204,93 @@ static void load_tag_to_meta(DB_playItem_t *track) {
     set_track_meta_playcount(track, count);
 }
 
+static void load_tag_to_meta(DB_playItem_t *track) {
+    load_count_to_meta(track, get_track_tag_playcount(track));
+}
+
+// Tracks collected for a bulk tag scan (see scan.h). Scanning many files at
+// once avoids paying the full read latency of each file in turn, which
+// dominates when the page cache is cold.
+typedef struct {
+    DB_playItem_t **tracks;
+    scan_item_t *items;
+    size_t count;
+    size_t capacity;
+} tag_scan_t;
+
+/**
+ * Add a track to a bulk tag scan.
+ *
+ * @param scan  A pointer to the scan.
+ * @param track  A pointer to the track.
+ * @return  A positive integer if an error occurred, zero otherwise.
+ */
+static uint8_t tag_scan_add(tag_scan_t *scan, DB_playItem_t *track) {
+    if (scan->count == scan->capacity) {
+        size_t capacity = scan->capacity ? scan->capacity * 2 : 256;
+
+        DB_playItem_t **tracks = realloc(scan->tracks, capacity * sizeof *tracks);
+        if (!tracks) { return 1; }
+        scan->tracks = tracks;
+
+        scan_item_t *items = realloc(scan->items, capacity * sizeof *items);
+        if (!items) { return 1; }
+        scan->items = items;
+
+        scan->capacity = capacity;
+    }
+
+    deadbeef->pl_lock();
+    char *location = strdup(deadbeef->pl_find_meta(track, LOCATION_TAG));
+    deadbeef->pl_unlock();
+
+    if (!location) { return 1; }
+
+    deadbeef->pl_item_ref(track);
+    scan->tracks[scan->count] = track;
+    scan->items[scan->count].location = location;
+    scan->count++;
+
+    return 0;
+}
+
+/**
+ * Load tag PCNT to meta play_count for all tracks in a bulk tag scan, then
+ * release the scan's resources.
+ *
+ * Tags which the scan can't read are loaded the regular way.
+ *
+ * @param scan  A pointer to the scan.
+ */
+static void tag_scan_load_to_meta(tag_scan_t *scan) {
+    scan_pcnt_counts(scan->items, scan->count);
+
+    for (size_t i = 0; i < scan->count; i++) {
+        DB_playItem_t *track = scan->tracks[i];
+        scan_item_t *item = &scan->items[i];
+
+        if (item->status == SCAN_STATUS_OK) {
+            load_count_to_meta(track, item->count);
+        } else {
+            load_tag_to_meta(track);
+        }
+
+        free((char *) item->location);
+        deadbeef->pl_item_unref(track);
+    }
+
+    free(scan->tracks);
+    free(scan->items);
+}
+
 // Load tag PCNT to meta play_count for all tracks.
 static void load_tags_to_meta(void) {
+    tag_scan_t scan = {0};
     DB_playItem_t *track = deadbeef->pl_get_first(PL_MAIN);
 
     while (track) {
         if (is_track_tag_supported(track)) {
-            load_tag_to_meta(track);
+            if (tag_scan_add(&scan, track)) { load_tag_to_meta(track); }
 #ifdef DEBUG
         } else {
             deadbeef->pl_lock();
@@ -193,20 +300,24 @@ static void load_tags_to_meta(void) {
 #endif
         }
 
+        DB_playItem_t *next = deadbeef->pl_get_next(track, PL_MAIN);
         deadbeef->pl_item_unref(track);
-        track = deadbeef->pl_get_next(track, PL_MAIN);
+        track = next;
     }
+
+    tag_scan_load_to_meta(&scan);
 }
 
 // Load tag PCNT to meta play_count for tracks without a meta value.
 static void load_tags_to_missing_meta(void) {
+    tag_scan_t scan = {0};
     DB_playItem_t *track = deadbeef->pl_get_first(PL_MAIN);
 
     while (track) {
         if (is_track_tag_supported(track)) {
             int count = get_track_meta_playcount(track);
             if (count < 0) {
-                load_tag_to_meta(track);
+                if (tag_scan_add(&scan, track)) { load_tag_to_meta(track); }
 #ifdef DEBUG
                 deadbeef->pl_lock();
                 const char *location = deadbeef->pl_find_meta(track, LOCATION_TAG);
@@ -216,20 +327,32 @@ static void load_tags_to_missing_meta(void) {
             }
         }
 
+        DB_playItem_t *next = deadbeef->pl_get_next(track, PL_MAIN);
         deadbeef->pl_item_unref(track);
-        track = deadbeef->pl_get_next(track, PL_MAIN);
+        track = next;
     }
+
+    tag_scan_load_to_meta(&scan);
 }
 
-static void set_track_playcount(DB_playItem_t *track, int count) {
+// Save the play count to both meta and tags. The caller must hold
+// tag_write_mutex, so the pair isn't interleaved with an import.
+static void store_track_playcount(DB_playItem_t *track, int count) {
     set_track_meta_playcount(track, count);
     set_track_tag_playcount(track, count);
 }
 
+static void set_track_playcount(DB_playItem_t *track, int count) {
+    deadbeef->mutex_lock(tag_write_mutex);
+    store_track_playcount(track, count);
+    deadbeef->mutex_unlock(tag_write_mutex);
+}
+
 // Increment track play count (using meta play_count as the authoritative
 // value). Ensure the incremented value is valid, and then save to both meta
 // and tags.
 static void inc_track_playcount(DB_playItem_t *track) {
+    deadbeef->mutex_lock(tag_write_mutex);
     int count = get_track_meta_playcount(track);
 
     if (count < 0) {
@@ -248,7 +371,444 @@ static void inc_track_playcount(DB_playItem_t *track) {
         count += 1;
     }
 
-    set_track_playcount(track, count);
+    store_track_playcount(track, count);
+    deadbeef->mutex_unlock(tag_write_mutex);
+}
+
+//
+//  Import/Export
+//
+// Play counts can be moved in bulk between a record file (see records.h) and
+// the playlist. Export is a single locked pass over meta (plus a tag read for
+// the rare counts too large for meta). Import streams the records, joins them
+// against the playlist through a location hash index, and then writes tags
+// ordered by where the files live on disk.
+static const char *TRANSFER_PATH_CONF = "playcount.transfer_path";
+static const char *TRANSFER_DEFAULT_FILE = "playcount.csv";
+
+typedef struct {
+    uint64_t hash;
+    char *location;
+    DB_playItem_t *track;
+    DB_playItem_t **duplicates; // Other playlist items for the same file.
+    size_t duplicate_count;
+    intptr_t pending;       // Index of the track's pending write, or -1.
+} track_index_entry_t;
+
+typedef struct {
+    track_index_entry_t *entries;
+    size_t capacity;        // Always a power of two.
+} track_index_t;
+
+typedef struct {
+    track_index_entry_t *entry;
+    uintmax_t count;
+    dev_t device;
+    ino_t inode;
+} pending_write_t;
+
+// Guarded by the playlist lock.
+static int transfer_running = 0;
+static int transfer_cancelled = 0;
+static intptr_t transfer_tid = 0;
+
+static int is_transfer_cancelled(void) {
+    deadbeef->pl_lock();
+    int cancelled = transfer_cancelled;
+    deadbeef->pl_unlock();
+    return cancelled;
+}
+
+// FNV-1a.
+static uint64_t hash_location(const char *location) {
+    uint64_t hash = 14695981039346656037u;
+    for (const unsigned char *c = (const unsigned char *) location; *c; c++) {
+        hash ^= *c;
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
+/**
+ * Find the index slot for a location: either its entry, or the empty slot
+ * where it would be inserted.
+ */
+static track_index_entry_t *track_index_slot(track_index_t *index, const char *location, uint64_t hash) {
+    size_t mask = index->capacity - 1;
+    size_t i = hash & mask;
+
+    while (index->entries[i].location) {
+        track_index_entry_t *entry = &index->entries[i];
+        if (entry->hash == hash && !strcmp(entry->location, location)) { break; }
+        i = (i + 1) & mask;
+    }
+
+    return &index->entries[i];
+}
+
+static void track_index_free(track_index_t *index) {
+    for (size_t i = 0; i < index->capacity; i++) {
+        track_index_entry_t *entry = &index->entries[i];
+        if (entry->location) {
+            free(entry->location);
+            deadbeef->pl_item_unref(entry->track);
+
+            for (size_t j = 0; j < entry->duplicate_count; j++) {
+                deadbeef->pl_item_unref(entry->duplicates[j]);
+            }
+            free(entry->duplicates);
+        }
+    }
+
+    free(index->entries);
+    index->entries = NULL;
+    index->capacity = 0;
+}
+
+/**
+ * Index all supported tracks in the playlist by location.
+ *
+ * @param index  A pointer to the index to fill.
+ * @return  A positive integer if an error occurred, zero otherwise.
+ */
+static uint8_t track_index_build(track_index_t *index) {
+    deadbeef->pl_lock();
+
+    // Keep the load factor at or below one half.
+    size_t capacity = 16;
+    size_t track_count = deadbeef->pl_getcount(PL_MAIN);
+    while (capacity < track_count * 2) { capacity <<= 1u; }
+
+    index->entries = calloc(capacity, sizeof *index->entries);
+    index->capacity = index->entries ? capacity : 0;
+
+    DB_playItem_t *track = index->entries ? deadbeef->pl_get_first(PL_MAIN) : NULL;
+
+    while (track) {
+        if (is_track_tag_supported(track)) {
+            const char *location = deadbeef->pl_find_meta(track, LOCATION_TAG);
+            uint64_t hash = hash_location(location);
+            track_index_entry_t *entry = track_index_slot(index, location, hash);
+
+            if (!entry->location) {
+                entry->location = strdup(location);
+                if (!entry->location) { break; }
+                entry->hash = hash;
+                entry->pending = -1;
+                entry->track = track;
+                deadbeef->pl_item_ref(track);
+
+            } else {
+                // The same file may appear more than once. All of its items
+                // need the new meta, otherwise playing a stale one would write
+                // its old count back to the tag.
+                DB_playItem_t **duplicates = realloc(entry->duplicates,
+                        (entry->duplicate_count + 1) * sizeof *duplicates);
+                if (!duplicates) { break; }
+
+                entry->duplicates = duplicates;
+                entry->duplicates[entry->duplicate_count++] = track;
+                deadbeef->pl_item_ref(track);
+            }
+        }
+
+        DB_playItem_t *next = deadbeef->pl_get_next(track, PL_MAIN);
+        deadbeef->pl_item_unref(track);
+        track = next;
+    }
+
+    deadbeef->pl_unlock();
+
+    if (!index->entries || track) {
+        if (track) { deadbeef->pl_item_unref(track); }
+        track_index_free(index);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Order writes by device then inode, which approximates on-disk order for
+// most file systems and keeps the drive from seeking back and forth.
+static int compare_pending_writes(const void *a, const void *b) {
+    const pending_write_t *lhs = a;
+    const pending_write_t *rhs = b;
+
+    if (lhs->device != rhs->device) { return lhs->device < rhs->device ? -1 : 1; }
+    if (lhs->inode != rhs->inode) { return lhs->inode < rhs->inode ? -1 : 1; }
+    return strcmp(lhs->entry->location, rhs->entry->location);
+}
+
+/**
+ * Apply pending writes to meta and tags.
+ *
+ * Each track's meta and tag are updated together under tag_write_mutex, so a
+ * play recorded during the import isn't overwritten by a stale count. Writes
+ * are skipped for tracks whose meta already holds the imported value,
+ * as meta is loaded from the tags when the plugin connects.
+ *
+ * @return  The number of tracks updated.
+ */
+static size_t apply_pending_writes(pending_write_t *writes, size_t write_count) {
+    size_t updated = 0;
+
+    // Files which no longer exist are dropped.
+    size_t kept = 0;
+    for (size_t i = 0; i < write_count; i++) {
+        struct stat info;
+        if (stat(writes[i].entry->location, &info)) { continue; }
+
+        writes[kept] = writes[i];
+        writes[kept].device = info.st_dev;
+        writes[kept].inode = info.st_ino;
+        kept++;
+    }
+    write_count = kept;
+    qsort(writes, write_count, sizeof *writes, compare_pending_writes);
+
+    for (size_t i = 0; i < write_count; i++) {
+        // Each write can be slow on a cold disk, and stop() waits for us.
+        if (is_transfer_cancelled()) { break; }
+
+        track_index_entry_t *entry = writes[i].entry;
+        uintmax_t count = writes[i].count;
+
+        deadbeef->mutex_lock(tag_write_mutex);
+
+        // The tag is written first, so meta never shows a count that didn't
+        // reach the file. Meta only holds an int, but the tag keeps the full
+        // count.
+        int meta_count = count > INT_MAX ? INT_MAX : (int) count;
+        uint8_t stale = count >= INT_MAX || get_track_meta_playcount(entry->track) != meta_count;
+
+        for (size_t j = 0; j < entry->duplicate_count; j++) {
+            if (get_track_meta_playcount(entry->duplicates[j]) != meta_count) { stale = 1; }
+        }
+
+        if (stale && !write_track_tag_playcount(entry->track, entry->location, count)) {
+            set_track_meta_playcount(entry->track, meta_count);
+            for (size_t j = 0; j < entry->duplicate_count; j++) {
+                set_track_meta_playcount(entry->duplicates[j], meta_count);
+            }
+            updated++;
+        }
+
+        deadbeef->mutex_unlock(tag_write_mutex);
+    }
+
+    return updated;
+}
+
+/**
+ * Import play counts from a record file into meta and tags.
+ *
+ * Records for tracks which aren't in the playlist (or aren't supported) are
+ * ignored. If a location appears more than once the last record wins.
+ *
+ * @param path  The record file path.
+ * @return  A positive integer if an error occurred, zero otherwise.
+ */
+static uint8_t import_playcounts(const char *path) {
+    records_reader_t *reader = records_reader_open(path);
+    if (!reader) {
+#ifdef DEBUG
+        trace("playcount: unable to open '%s' for import\n", path)
+#endif
+        return 1;
+    }
+
+    track_index_t index = {0};
+    if (track_index_build(&index)) {
+        records_reader_close(reader);
+        return 1;
+    }
+
+    pending_write_t *writes = NULL;
+    size_t write_count = 0;
+    size_t write_capacity = 0;
+    size_t record_count = 0;
+
+    const char *location = NULL;
+    uintmax_t count = 0;
+    int status = 0;
+
+    while ((status = records_reader_next(reader, &location, &count)) > 0) {
+        if (is_transfer_cancelled()) { break; }
+        record_count++;
+
+        track_index_entry_t *entry = track_index_slot(&index, location, hash_location(location));
+        if (!entry->location) { continue; }
+
+        if (entry->pending >= 0) {
+            writes[entry->pending].count = count;
+            continue;
+        }
+
+        if (write_count == write_capacity) {
+            size_t capacity = write_capacity ? write_capacity * 2 : 64;
+            pending_write_t *grown = realloc(writes, capacity * sizeof *writes);
+            if (!grown) { status = -1; break; }
+            writes = grown;
+            write_capacity = capacity;
+        }
+
+        writes[write_count] = (pending_write_t) { .entry = entry, .count = count };
+        entry->pending = write_count++;
+    }
+
+    records_reader_close(reader);
+
+#ifdef DEBUG
+    if (status < 0) {
+        trace("playcount: import failed after %zu records of '%s'\n", record_count, path)
+    }
+#endif
+
+    // Apply whatever was read, even if the file was truncated.
+    size_t updated = apply_pending_writes(writes, write_count);
+
+#ifdef DEBUG
+    trace("playcount: imported %zu records, %zu matched, %zu updated\n",
+          record_count, write_count, updated)
+#else
+    UNUSED(updated)
+#endif
+
+    free(writes);
+    track_index_free(&index);
+    return status < 0;
+}
+
+/**
+ * Export the meta play counts of all tracks in the playlist to a record file.
+ *
+ * Tracks without a meta play count are skipped. Meta is capped at INT_MAX, so
+ * for tracks at the cap the (possibly larger) tag count is exported instead.
+ *
+ * @param path  The record file path. Ending in '.csv' selects the CSV format.
+ * @return  A positive integer if an error occurred, zero otherwise.
+ */
+static uint8_t export_playcounts(const char *path) {
+    records_writer_t *writer = records_writer_open(path, records_format_from_path(path));
+    if (!writer) {
+#ifdef DEBUG
+        trace("playcount: unable to open '%s' for export\n", path)
+#endif
+        return 1;
+    }
+
+    uint8_t failed = 0;
+    tag_scan_t capped = {0};
+
+    deadbeef->pl_lock();
+    DB_playItem_t *track = deadbeef->pl_get_first(PL_MAIN);
+
+    while (track) {
+        int count = get_track_meta_playcount(track);
+        const char *location = deadbeef->pl_find_meta(track, LOCATION_TAG);
+
+        // Capped tracks are exported after the pass, as tag_write_mutex must
+        // not be taken while holding the playlist lock.
+        uint8_t deferred = count == INT_MAX && is_track_tag_supported(track)
+                && !tag_scan_add(&capped, track);
+
+        if (!deferred && !failed && count >= 0 && location) {
+            failed = records_writer_put(writer, location, count);
+        }
+
+        DB_playItem_t *next = deadbeef->pl_get_next(track, PL_MAIN);
+        deadbeef->pl_item_unref(track);
+        track = next;
+    }
+    deadbeef->pl_unlock();
+
+    // Read the tags of capped tracks. The write mutex keeps an import or play
+    // from rewriting a tag while it's read.
+    for (size_t i = 0; i < capped.count; i++) {
+        deadbeef->mutex_lock(tag_write_mutex);
+        uintmax_t count = get_track_tag_playcount(capped.tracks[i]);
+        deadbeef->mutex_unlock(tag_write_mutex);
+
+        if (count < INT_MAX) { count = INT_MAX; }
+        if (!failed) { failed = records_writer_put(writer, capped.items[i].location, count); }
+
+        free((char *) capped.items[i].location);
+        deadbeef->pl_item_unref(capped.tracks[i]);
+    }
+    free(capped.tracks);
+    free(capped.items);
+
+    if (records_writer_close(writer)) { failed = 1; }
+#ifdef DEBUG
+    if (failed) { trace("playcount: export to '%s' failed\n", path) }
+#endif
+
+    return failed;
+}
+
+static void get_transfer_path(char *buffer, int buffer_size) {
+    deadbeef->conf_get_str(TRANSFER_PATH_CONF, "", buffer, buffer_size);
+
+    if (!buffer[0]) {
+        snprintf(buffer, buffer_size, "%s/%s",
+                 deadbeef->get_system_dir(DDB_SYS_DIR_CONFIG), TRANSFER_DEFAULT_FILE);
+    }
+}
+
+// Imports and exports can take a while, so they're run off the UI thread. Only
+// one may run at a time, and stop() waits for it to finish. Export holds the
+// playlist lock throughout, so only an import can be cancelled part way.
+static void transfer_thread(void *ctx) {
+    char path[PATH_MAX];
+    get_transfer_path(path, sizeof path);
+
+    if (ctx) {
+        import_playcounts(path);
+        if (!is_transfer_cancelled()) {
+            deadbeef->sendmessage(DB_EV_PLAYLISTCHANGED, 0, 0, 0);
+        }
+    } else {
+        export_playcounts(path);
+    }
+
+    deadbeef->pl_lock();
+    transfer_running = 0;
+    deadbeef->pl_unlock();
+}
+
+static void start_transfer(int is_import) {
+    deadbeef->pl_lock();
+    int running = transfer_running;
+    transfer_running = 1;
+    deadbeef->pl_unlock();
+
+    if (running) {
+#ifdef DEBUG
+        trace("playcount: an import or export is already running\n")
+#endif
+        return;
+    }
+
+    // Reap the previous (finished) transfer.
+    if (transfer_tid) { deadbeef->thread_join(transfer_tid); }
+
+    intptr_t tid = deadbeef->thread_start(transfer_thread, is_import ? (void *) 1 : NULL);
+
+    deadbeef->pl_lock();
+    transfer_tid = tid;
+    if (!tid) { transfer_running = 0; }
+    deadbeef->pl_unlock();
+}
+
+// Cancel any running transfer, and wait for it to finish.
+static void stop_transfer(void) {
+    deadbeef->pl_lock();
+    transfer_cancelled = 1;
+    intptr_t tid = transfer_tid;
+    transfer_tid = 0;
+    deadbeef->pl_unlock();
+
+    if (tid) { deadbeef->thread_join(tid); }
 }
 
 //
@@ -256,7 +816,8 @@ static void inc_track_playcount(DB_playItem_t *track) {
 //
 static int start(void) {
     // Note: Plugin will be unloaded if start returns -1.
-    return 0;
+    tag_write_mutex = deadbeef->mutex_create();
+    return tag_write_mutex ? 0 : -1;
 }
 
 static int connect(void) {
@@ -268,6 +829,8 @@ static int connect(void) {
 }
 
 static int stop(void) {
+    stop_transfer();
+    deadbeef->mutex_free(tag_write_mutex);
     return 0;
 }
 
@@ -305,7 +868,42 @@ static DB_plugin_action_t increment_playcount_action = {
 };
 #endif
 
+static int export_playcounts_callback(
+        struct DB_plugin_action_s *action, void *userdata) {
+    UNUSED(action)
+    UNUSED(userdata)
+    start_transfer(0);
+    return 0;
+}
+
+static int import_playcounts_callback(
+        struct DB_plugin_action_s *action, void *userdata) {
+    UNUSED(action)
+    UNUSED(userdata)
+    start_transfer(1);
+    return 0;
+}
+
+static DB_plugin_action_t export_playcounts_action = {
+        .title = "File/Export Playcounts",
+        .name = "export_playcounts",
+        .flags = DB_ACTION_COMMON | DB_ACTION_ADD_MENU,
+        .callback = export_playcounts_callback,
+        .next = NULL
+};
+
+static DB_plugin_action_t import_playcounts_action = {
+        .title = "File/Import Playcounts",
+        .name = "import_playcounts",
+        .flags = DB_ACTION_COMMON | DB_ACTION_ADD_MENU,
+        .callback = import_playcounts_callback,
+        .next = &export_playcounts_action
+};
+
 static DB_plugin_action_t *get_actions(DB_playItem_t *it) {
+    // Main menu actions are requested without a track.
+    if (!it) { return &import_playcounts_action; }
+
     // Metadata is temporary, so only allow it to be displayed/modified if
     // we can actually save its state.
     if (is_track_tag_supported(it)) {
@@ -455,7 +1053,9 @@ static DB_misc_t plugin = {
         .exec_cmdline = NULL,
         .get_actions = get_actions,
         .message = handle_event,
-        .configdialog = NULL
+        .configdialog =
+            "property \"Import/export file (.csv, otherwise binary)\" "
+            "entry playcount.transfer_path \"\";\n"
     }
 };
 
@@ -0,0 +1,334 @@
+/* Copyright (c) 2019, Andrew Wylie. All rights reserved.   */
+/* Distributed under the terms of the 3-Clause BSD License. */
+/* Full license text available in 'LICENSE' file.           */
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "records.h"
+
+static const char BINARY_MAGIC[4] = {'D', 'B', 'P', 'C'};
+static const uint8_t BINARY_VERSION = 1;
+static const char *CSV_HEADER = "play_count,uri\n";
+static const char *CSV_EXTENSION = ".csv";
+
+// Guard against allocating huge buffers for corrupt binary files.
+static const uint32_t MAX_LOCATION_SIZE = 1u << 16u;
+
+struct records_reader_s {
+    FILE *file;
+    records_format_t format;
+    char *buffer;       // CSV: the most recently read line.
+    size_t buffer_size;
+    char *line;         // CSV: the current (possibly multi-line) record.
+    size_t line_size;
+    char *location;     // The current record's location.
+    size_t location_size;
+};
+
+struct records_writer_s {
+    FILE *file;
+    records_format_t format;
+};
+
+records_format_t records_format_from_path(const char *path) {
+    size_t length = strlen(path);
+    size_t extension_length = strlen(CSV_EXTENSION);
+
+    if (length >= extension_length
+            && !strcasecmp(path + length - extension_length, CSV_EXTENSION)) {
+        return RECORDS_FORMAT_CSV;
+    }
+
+    return RECORDS_FORMAT_BINARY;
+}
+
+//
+//  Big Endian (network byte order) helpers.
+//
+static void put_be(uint8_t *buffer, uint64_t value, uint8_t width) {
+    for (uint8_t i = 0; i < width; i++) {
+        buffer[width - i - 1] = value & 0xffu;
+        value >>= 8u;
+    }
+}
+
+static uint64_t get_be(const uint8_t *buffer, uint8_t width) {
+    uint64_t value = 0;
+    for (uint8_t i = 0; i < width; i++) {
+        value = (value << 8u) | buffer[i];
+    }
+    return value;
+}
+
+/**
+ * Ensure the reader's location buffer can hold a string of the given length.
+ *
+ * @return  A positive integer if an error occurred, zero otherwise.
+ */
+static uint8_t reserve_location(records_reader_t *reader, size_t length) {
+    if (length + 1 <= reader->location_size) { return 0; }
+
+    char *location = realloc(reader->location, length + 1);
+    if (!location) { return 1; }
+
+    reader->location = location;
+    reader->location_size = length + 1;
+    return 0;
+}
+
+//
+//  Reading.
+//
+records_reader_t *records_reader_open(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) { return NULL; }
+
+    records_reader_t *reader = calloc(1, sizeof *reader);
+    if (!reader) {
+        fclose(file);
+        return NULL;
+    }
+    reader->file = file;
+
+    // Binary files start with a magic value, anything else is treated as CSV.
+    uint8_t header[sizeof BINARY_MAGIC + 1];
+    size_t read = fread(header, 1, sizeof header, file);
+
+    if (read == sizeof header && !memcmp(header, BINARY_MAGIC, sizeof BINARY_MAGIC)) {
+        if (header[sizeof BINARY_MAGIC] != BINARY_VERSION) {
+            records_reader_close(reader);
+            return NULL;
+        }
+        reader->format = RECORDS_FORMAT_BINARY;
+
+    } else {
+        reader->format = RECORDS_FORMAT_CSV;
+        rewind(file);
+    }
+
+    return reader;
+}
+
+static int read_binary_record(
+        records_reader_t *reader, const char **location, uintmax_t *count) {
+
+    uint8_t header[sizeof(uint64_t) + sizeof(uint32_t)];
+    size_t read = fread(header, 1, sizeof header, reader->file);
+
+    if (read == 0 && feof(reader->file)) { return 0; }
+    if (read != sizeof header) { return -1; }
+
+    uint64_t value = get_be(header, sizeof(uint64_t));
+    uint32_t length = get_be(header + sizeof(uint64_t), sizeof(uint32_t));
+
+    if (length > MAX_LOCATION_SIZE) { return -1; }
+    if (reserve_location(reader, length)) { return -1; }
+    if (fread(reader->location, 1, length, reader->file) != length) { return -1; }
+    reader->location[length] = '\0';
+
+    *location = reader->location;
+    *count = value;
+    return 1;
+}
+
+/**
+ * Parse a CSV location field (quoted or unquoted) into the location buffer.
+ *
+ * @param field  The start of the field, after the count's comma.
+ * @param length  Set to the parsed length. Negative if a quote is unclosed.
+ * @return  A positive integer if an error occurred, zero otherwise.
+ */
+static uint8_t parse_csv_location(records_reader_t *reader, const char *field, long *length) {
+    size_t field_length = strcspn(field, "\r\n");
+    if (reserve_location(reader, field_length)) { return 1; }
+
+    if (*field != '"') {
+        memcpy(reader->location, field, field_length);
+        reader->location[field_length] = '\0';
+        *length = field_length;
+        return 0;
+    }
+
+    // Quoted field. Doubled quotes are unescaped and newlines may be embedded,
+    // so parse the whole remainder of the buffer rather than a single line.
+    field_length = strlen(field);
+    if (reserve_location(reader, field_length)) { return 1; }
+
+    size_t out = 0;
+    for (size_t i = 1; i < field_length; i++) {
+        if (field[i] == '"') {
+            if (field[i + 1] != '"') {
+                reader->location[out] = '\0';
+                *length = out;
+                return 0;
+            }
+            i++;
+        }
+        reader->location[out++] = field[i];
+    }
+
+    *length = -1;
+    return 0;
+}
+
+static int read_csv_record(
+        records_reader_t *reader, const char **location, uintmax_t *count) {
+
+    size_t used = 0;
+    long resync = -1;   // File offset after a record's first line, while its quote is unclosed.
+    int ret = 0;
+
+    while (1) {
+        ssize_t read = getline(&reader->buffer, &reader->buffer_size, reader->file);
+
+        if (read < 0 && ferror(reader->file)) {
+            ret = -1;
+            break;
+        }
+
+        // An unclosed quote which runs too long (or to the end of the file) is
+        // dropped, and reading resumes at the line after its record began.
+        if (resync >= 0 && (read < 0 || used + read > MAX_LOCATION_SIZE)) {
+            if (fseek(reader->file, resync, SEEK_SET)) { ret = -1; break; }
+            used = 0;
+            resync = -1;
+            continue;
+        }
+
+        if (read < 0) { break; }
+
+        // Append the line to the (possibly multi-line) record.
+        if (used + read + 1 > reader->line_size) {
+            char *line = realloc(reader->line, used + read + 1);
+            if (!line) { ret = -1; break; }
+            reader->line = line;
+            reader->line_size = used + read + 1;
+        }
+        memcpy(reader->line + used, reader->buffer, read + 1);
+        used += read;
+
+        // Skip blank lines and the header (or anything not starting with a count).
+        const char *cursor = reader->line;
+        while (*cursor == ' ' || *cursor == '\t') { cursor++; }
+        if (!isdigit((unsigned char) *cursor)) { used = 0; continue; }
+
+        // Counts which don't fit are malformed, not UINTMAX_MAX.
+        char *end = NULL;
+        errno = 0;
+        uintmax_t value = strtoumax(cursor, &end, 10);
+        if (errno == ERANGE) { used = 0; continue; }
+
+        while (*end == ' ' || *end == '\t') { end++; }
+        if (*end != ',') { used = 0; continue; }
+
+        long length = 0;
+        if (parse_csv_location(reader, end + 1, &length)) { ret = -1; break; }
+        if (length < 0) {
+            // Unclosed quote, read the next line.
+            if (resync < 0) {
+                resync = ftell(reader->file);
+                if (resync < 0) { ret = -1; break; }
+            }
+            continue;
+        }
+        if (length == 0) { used = 0; continue; }
+
+        *location = reader->location;
+        *count = value;
+        ret = 1;
+        break;
+    }
+
+    return ret;
+}
+
+int records_reader_next(records_reader_t *reader, const char **location, uintmax_t *count) {
+    if (reader->format == RECORDS_FORMAT_BINARY) {
+        return read_binary_record(reader, location, count);
+    }
+    return read_csv_record(reader, location, count);
+}
+
+void records_reader_close(records_reader_t *reader) {
+    if (!reader) { return; }
+
+    fclose(reader->file);
+    free(reader->buffer);
+    free(reader->line);
+    free(reader->location);
+    free(reader);
+}
+
+//
+//  Writing.
+//
+records_writer_t *records_writer_open(const char *path, records_format_t format) {
+    FILE *file = fopen(path, "wb");
+    if (!file) { return NULL; }
+
+    records_writer_t *writer = calloc(1, sizeof *writer);
+    if (!writer) {
+        fclose(file);
+        return NULL;
+    }
+    writer->file = file;
+    writer->format = format;
+
+    int failed = 0;
+    if (format == RECORDS_FORMAT_BINARY) {
+        failed = fwrite(BINARY_MAGIC, 1, sizeof BINARY_MAGIC, file) != sizeof BINARY_MAGIC
+                || fputc(BINARY_VERSION, file) == EOF;
+    } else {
+        failed = fputs(CSV_HEADER, file) == EOF;
+    }
+
+    if (failed) {
+        records_writer_close(writer);
+        remove(path);
+        return NULL;
+    }
+
+    return writer;
+}
+
+uint8_t records_writer_put(records_writer_t *writer, const char *location, uintmax_t count) {
+    FILE *file = writer->file;
+
+    if (writer->format == RECORDS_FORMAT_BINARY) {
+        size_t length = strlen(location);
+        if (length > MAX_LOCATION_SIZE) { return 1; }
+
+        uint8_t header[sizeof(uint64_t) + sizeof(uint32_t)];
+        put_be(header, count, sizeof(uint64_t));
+        put_be(header + sizeof(uint64_t), length, sizeof(uint32_t));
+
+        if (fwrite(header, 1, sizeof header, file) != sizeof header) { return 1; }
+        if (fwrite(location, 1, length, file) != length) { return 1; }
+        return 0;
+    }
+
+    if (fprintf(file, "%ju,\"", count) < 0) { return 1; }
+    for (const char *c = location; *c; c++) {
+        if (*c == '"' && fputc('"', file) == EOF) { return 1; }
+        if (fputc(*c, file) == EOF) { return 1; }
+    }
+    if (fputs("\"\n", file) == EOF) { return 1; }
+
+    return 0;
+}
+
+uint8_t records_writer_close(records_writer_t *writer) {
+    if (!writer) { return 0; }
+
+    uint8_t failed = ferror(writer->file) != 0;
+    if (fclose(writer->file)) { failed = 1; }
+    free(writer);
+
+    return failed;
+}
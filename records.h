@@ -0,0 +1,100 @@
+/* Copyright (c) 2019, Andrew Wylie. All rights reserved.   */
+/* Distributed under the terms of the 3-Clause BSD License. */
+/* Full license text available in 'LICENSE' file.           */
+#ifndef PLAYCOUNT_RECORDS_H_
+#define PLAYCOUNT_RECORDS_H_
+
+#include <stdint.h>
+
+/**
+ * Play count records are (location, count) pairs, used to move play counts
+ * between players or to back them up.
+ *
+ * Two file formats are supported:
+ *
+ *   - CSV: A 'play_count,uri' header line, followed by one record per line.
+ *     The location is always quoted when written (embedded quotes doubled),
+ *     and may be either quoted or unquoted when read.
+ *
+ *   - Binary: The magic bytes "DBPC" and a version byte, followed by records
+ *     of a 64-bit count, a 32-bit location length, and the location bytes
+ *     (no terminator). Integers use Big Endian (network byte order), the same
+ *     as the ID3v2 specification.
+ *
+ * Records are streamed one at a time, so a file never needs to fit in memory.
+ */
+typedef enum {
+    RECORDS_FORMAT_CSV,
+    RECORDS_FORMAT_BINARY
+} records_format_t;
+
+typedef struct records_reader_s records_reader_t;
+typedef struct records_writer_s records_writer_t;
+
+/**
+ * Choose a record format for a file based on its name.
+ *
+ * @param path  The file path.
+ * @return  RECORDS_FORMAT_CSV for '.csv' files, RECORDS_FORMAT_BINARY otherwise.
+ */
+records_format_t records_format_from_path(const char *path);
+
+/**
+ * Open a record file for reading. The format is detected from its contents.
+ *
+ * @param path  The file path.
+ * @return  A pointer to the reader, or NULL if the file couldn't be opened.
+ */
+records_reader_t *records_reader_open(const char *path);
+
+/**
+ * Read the next record.
+ *
+ * The location remains valid until the next call, or until the reader is
+ * closed. Malformed CSV lines are skipped, including a quoted location which
+ * isn't closed within 64 KiB (or before the end of the file),
+ * in which case reading resumes at the line after it.
+ *
+ * @param reader  A pointer to the reader.
+ * @param location  Set to the record's location.
+ * @param count  Set to the record's play count.
+ * @return  One if a record was read, zero at the end of the file, or -1 if
+ *          the file is malformed or a read error occurred.
+ */
+int records_reader_next(records_reader_t *reader, const char **location, uintmax_t *count);
+
+/**
+ * Close a reader and release its resources.
+ *
+ * @param reader  A pointer to the reader.
+ */
+void records_reader_close(records_reader_t *reader);
+
+/**
+ * Create a record file for writing, truncating any existing file.
+ *
+ * @param path  The file path.
+ * @param format  The record format to write.
+ * @return  A pointer to the writer, or NULL if the file couldn't be created.
+ */
+records_writer_t *records_writer_open(const char *path, records_format_t format);
+
+/**
+ * Append a record.
+ *
+ * @param writer  A pointer to the writer.
+ * @param location  The track location.
+ * @param count  The play count.
+ * @return  A positive integer if an error occurred, zero otherwise.
+ */
+uint8_t records_writer_put(records_writer_t *writer, const char *location, uintmax_t count);
+
+/**
+ * Flush and close a writer, releasing its resources.
+ *
+ * @param writer  A pointer to the writer.
+ * @return  A positive integer if an error occurred, zero otherwise.
+ */
+uint8_t records_writer_close(records_writer_t *writer);
+
+#endif //PLAYCOUNT_RECORDS_H_
@@ -0,0 +1,540 @@
+/* Copyright (c) 2019, Andrew Wylie. All rights reserved.   */
+/* Distributed under the terms of the 3-Clause BSD License. */
+/* Full license text available in 'LICENSE' file.           */
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "scan.h"
+
+// Most tags (excluding cover art) fit within the first read, so usually only
+// a single read is needed per file.
+#define SCAN_CHUNK_SIZE 4096u
+
+// The number of files read concurrently.
+static const size_t SCAN_QUEUE_DEPTH = 256;
+
+static const char *FILE_URI_PREFIX = "file://";
+
+static const uint32_t TAG_HEADER_SIZE = 10;
+static const uint32_t FRAME_HEADER_SIZE = 10;
+static const char *PCNT_ID = "PCNT";
+
+static const uint8_t TAG_FLAG_UNSYNCHRONISATION = 0x80u;
+static const uint8_t TAG_FLAG_EXTENDED_HEADER = 0x40u;
+
+// Frame format flags which change how the frame data must be read.
+static const uint8_t FRAME_FORMAT_FLAGS_V3 = 0xe0u;  // Compression, encryption, grouping.
+static const uint8_t FRAME_FORMAT_FLAGS_V4 = 0x4fu;  // Grouping, compression, encryption, unsync, length.
+
+typedef struct {
+    scan_item_t *item;
+    int fd;
+    uint8_t version;
+    uint64_t file_size;
+    uint64_t tag_end;       // File offset of the end of the tag.
+    uint64_t frame_offset;  // File offset of the next frame header to parse.
+    uint64_t read_offset;   // File offset of the pending read.
+    uint64_t buffer_offset; // File offset of the buffer's first byte.
+    size_t buffer_length;
+    struct iovec iov;
+    uint8_t buffer[SCAN_CHUNK_SIZE];
+} scan_file_t;
+
+//
+//  Tag Parsing
+//
+static uint32_t get_be32(const uint8_t *bytes) {
+    return ((uint32_t) bytes[0] << 24u) | ((uint32_t) bytes[1] << 16u)
+            | ((uint32_t) bytes[2] << 8u) | bytes[3];
+}
+
+/**
+ * Decode a synchsafe integer (7 bits per byte).
+ *
+ * @return  Zero if the value was decoded, a positive integer if it's invalid.
+ */
+static uint8_t get_synchsafe32(const uint8_t *bytes, uint32_t *value) {
+    if ((bytes[0] | bytes[1] | bytes[2] | bytes[3]) & 0x80u) { return 1; }
+
+    *value = ((uint32_t) bytes[0] << 21u) | ((uint32_t) bytes[1] << 14u)
+            | ((uint32_t) bytes[2] << 7u) | bytes[3];
+    return 0;
+}
+
+// Same semantics as id3v2_pcnt_frame_get_count().
+static uintmax_t get_pcnt_count(const uint8_t *data, uint32_t size) {
+    if (size > sizeof(uintmax_t)) { return UINTMAX_MAX; }
+
+    uintmax_t count = 0;
+    for (uint32_t i = 0; i < size; i++) {
+        count = (count << 8u) | data[i];
+    }
+    return count;
+}
+
+static int scan_finish(scan_file_t *file, scan_status_t status) {
+    file->item->status = status;
+    return 0;
+}
+
+/**
+ * Request a read of the chunk starting at the given offset.
+ *
+ * @return  One if a read is needed, or zero (finished) if it would make no
+ *          progress, i.e. the file is truncated.
+ */
+static int scan_request(scan_file_t *file, uint64_t offset) {
+    if (offset == file->buffer_offset && file->buffer_length) {
+        return scan_finish(file, SCAN_STATUS_FALLBACK);
+    }
+
+    file->read_offset = offset;
+    file->iov.iov_base = file->buffer;
+    file->iov.iov_len = sizeof file->buffer;
+    return 1;
+}
+
+/**
+ * Parse the tag header from the first chunk of the file.
+ *
+ * @return  Zero if the header was parsed, a positive integer otherwise.
+ */
+static uint8_t scan_parse_header(scan_file_t *file) {
+    const uint8_t *buffer = file->buffer;
+
+    if (file->buffer_length < TAG_HEADER_SIZE || memcmp(buffer, "ID3", 3)) { return 1; }
+
+    file->version = buffer[3];
+    if (file->version != 3 && file->version != 4) { return 1; }
+    if (buffer[5] & TAG_FLAG_UNSYNCHRONISATION) { return 1; }
+
+    uint32_t tag_size = 0;
+    if (get_synchsafe32(buffer + 6, &tag_size)) { return 1; }
+
+    file->tag_end = TAG_HEADER_SIZE + tag_size;
+    file->frame_offset = TAG_HEADER_SIZE;
+
+    if (buffer[5] & TAG_FLAG_EXTENDED_HEADER) {
+        if (file->buffer_length < TAG_HEADER_SIZE + 4) { return 1; }
+
+        // ID3v2.3 excludes the size field from the size, ID3v2.4 doesn't.
+        uint32_t extended_size = 0;
+        if (file->version == 3) {
+            extended_size = get_be32(buffer + TAG_HEADER_SIZE) + 4;
+        } else if (get_synchsafe32(buffer + TAG_HEADER_SIZE, &extended_size)) {
+            return 1;
+        }
+        file->frame_offset += extended_size;
+    }
+
+    return 0;
+}
+
+/**
+ * Parse as much of the tag as the buffer allows, walking frame headers until
+ * the PCNT frame is found.
+ *
+ * @return  One if another read is needed, zero if the file is finished.
+ */
+static int scan_parse(scan_file_t *file) {
+    if (!file->tag_end && scan_parse_header(file)) {
+        return scan_finish(file, SCAN_STATUS_FALLBACK);
+    }
+
+    while (file->frame_offset + FRAME_HEADER_SIZE <= file->tag_end) {
+        // The tag claims to be larger than the file.
+        if (file->frame_offset + FRAME_HEADER_SIZE > file->file_size) {
+            return scan_finish(file, SCAN_STATUS_FALLBACK);
+        }
+
+        uint64_t start = file->frame_offset - file->buffer_offset;
+
+        if (file->frame_offset < file->buffer_offset
+                || start + FRAME_HEADER_SIZE > file->buffer_length) {
+            return scan_request(file, file->frame_offset);
+        }
+
+        const uint8_t *frame = file->buffer + start;
+
+        // Padding, there are no more frames.
+        if (!frame[0]) { break; }
+
+        for (uint8_t i = 0; i < 4; i++) {
+            if (!isupper(frame[i]) && !isdigit(frame[i])) {
+                return scan_finish(file, SCAN_STATUS_FALLBACK);
+            }
+        }
+
+        uint32_t size = 0;
+        if (file->version == 3) {
+            size = get_be32(frame + 4);
+        } else if (get_synchsafe32(frame + 4, &size)) {
+            return scan_finish(file, SCAN_STATUS_FALLBACK);
+        }
+
+        if (!memcmp(frame, PCNT_ID, 4)) {
+            uint8_t flags = file->version == 3 ? FRAME_FORMAT_FLAGS_V3 : FRAME_FORMAT_FLAGS_V4;
+            if (frame[9] & flags) { return scan_finish(file, SCAN_STATUS_FALLBACK); }
+
+            if (start + FRAME_HEADER_SIZE + size > file->buffer_length) {
+                if (FRAME_HEADER_SIZE + size > SCAN_CHUNK_SIZE) {
+                    return scan_finish(file, SCAN_STATUS_FALLBACK);
+                }
+                return scan_request(file, file->frame_offset);
+            }
+
+            file->item->count = get_pcnt_count(frame + FRAME_HEADER_SIZE, size);
+            return scan_finish(file, SCAN_STATUS_OK);
+        }
+
+        file->frame_offset += FRAME_HEADER_SIZE + size;
+    }
+
+    // No PCNT frame, which is a count of zero.
+    file->item->count = 0;
+    return scan_finish(file, SCAN_STATUS_OK);
+}
+
+/**
+ * Open a file and request its first read.
+ *
+ * @return  One if a read is needed, zero if the file is finished.
+ */
+static int scan_start(scan_file_t *file, scan_item_t *item) {
+    const char *path = item->location;
+    size_t prefix_length = strlen(FILE_URI_PREFIX);
+    if (!strncmp(path, FILE_URI_PREFIX, prefix_length)) { path += prefix_length; }
+
+    memset(file, 0, offsetof(scan_file_t, buffer));
+    file->item = item;
+    file->item->status = SCAN_STATUS_FALLBACK;
+    file->fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (file->fd < 0) { return 0; }
+
+    struct stat info;
+    if (fstat(file->fd, &info)) { return 0; }
+    file->file_size = info.st_size;
+
+    return scan_request(file, 0);
+}
+
+/**
+ * Handle the result of a file's pending read.
+ *
+ * @param result  The number of bytes read, or a negative value on error.
+ * @return  One if another read is needed, zero if the file is finished.
+ */
+static int scan_complete(scan_file_t *file, ssize_t result) {
+    if (result <= 0) { return scan_finish(file, SCAN_STATUS_FALLBACK); }
+
+    // Follow-up reads start at a frame header, so must at least cover it.
+    if (file->read_offset && result < FRAME_HEADER_SIZE) {
+        return scan_finish(file, SCAN_STATUS_FALLBACK);
+    }
+
+    file->buffer_offset = file->read_offset;
+    file->buffer_length = result;
+    return scan_parse(file);
+}
+
+static void scan_close(scan_file_t *file) {
+    if (file->fd >= 0) { close(file->fd); }
+    file->fd = -1;
+    file->item = NULL;
+}
+
+//
+//  I/O Engine: readv with read-ahead.
+//
+// Files are processed in windows. For each round, read-ahead is requested for
+// every pending read in the window so the device sees them all at once, then
+// the reads are made (which should mostly be served from the page cache).
+static void scan_readv(scan_file_t *files, scan_item_t *items, size_t item_count) {
+    for (size_t base = 0; base < item_count; base += SCAN_QUEUE_DEPTH) {
+        size_t window = item_count - base;
+        if (window > SCAN_QUEUE_DEPTH) { window = SCAN_QUEUE_DEPTH; }
+
+        size_t pending = 0;
+        for (size_t i = 0; i < window; i++) {
+            if (scan_start(&files[i], &items[base + i])) {
+                pending++;
+            } else {
+                scan_close(&files[i]);
+            }
+        }
+
+        while (pending) {
+            for (size_t i = 0; i < window; i++) {
+                if (!files[i].item) { continue; }
+                posix_fadvise(files[i].fd, files[i].read_offset,
+                              SCAN_CHUNK_SIZE, POSIX_FADV_WILLNEED);
+            }
+
+            for (size_t i = 0; i < window; i++) {
+                scan_file_t *file = &files[i];
+                if (!file->item) { continue; }
+
+                ssize_t result = preadv(file->fd, &file->iov, 1, file->read_offset);
+                if (result < 0 && errno == EINTR) { continue; }
+
+                if (!scan_complete(file, result)) {
+                    scan_close(file);
+                    pending--;
+                }
+            }
+        }
+    }
+}
+
+#ifdef HAVE_IO_URING
+//
+//  I/O Engine: io_uring.
+//
+// There's no dependency on liburing, the rings are set up directly.
+typedef struct {
+    int fd;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    unsigned to_submit;
+} uring_t;
+
+static void uring_close(uring_t *ring) {
+    if (ring->sqes) { munmap(ring->sqes, ring->sqes_size); }
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring) { munmap(ring->sq_ring, ring->sq_ring_size); }
+    close(ring->fd);
+}
+
+/**
+ * Set up an io_uring instance.
+ *
+ * @return  Zero if successful, a positive integer if io_uring is unavailable.
+ */
+static uint8_t uring_open(uring_t *ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof params);
+    memset(ring, 0, sizeof *ring);
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) { return 1; }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    uint8_t single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap && ring->cq_ring_size > ring->sq_ring_size) {
+        ring->sq_ring_size = ring->cq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        uring_close(ring);
+        return 1;
+    }
+
+    if (single_mmap) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            uring_close(ring);
+            return 1;
+        }
+    }
+
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        uring_close(ring);
+        return 1;
+    }
+
+    uint8_t *sq = ring->sq_ring;
+    ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+
+    uint8_t *cq = ring->cq_ring;
+    ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    return 0;
+}
+
+// Queue a file's pending read. The queue is never fuller than the number of
+// files in flight, which is at most the ring size.
+static void uring_queue_read(uring_t *ring, scan_file_t *file) {
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof *sqe);
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = file->fd;
+    sqe->off = file->read_offset;
+    sqe->addr = (uintptr_t) &file->iov;
+    sqe->len = 1;
+    sqe->user_data = (uintptr_t) file;
+
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+}
+
+/**
+ * Submit queued reads and wait for at least one completion.
+ *
+ * @return  Zero if successful, a positive integer otherwise.
+ */
+static uint8_t uring_submit_and_wait(uring_t *ring) {
+    while (1) {
+        int ret = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, 1,
+                          IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret >= 0) {
+            ring->to_submit -= ret;
+            return 0;
+        }
+        if (errno != EINTR) { return 1; }
+    }
+}
+
+/**
+ * Read files through io_uring, keeping up to the queue depth in flight.
+ *
+ * @return  Zero if successful, a positive integer if the ring failed. Items
+ *          which weren't finished are left with SCAN_STATUS_FALLBACK.
+ */
+static uint8_t scan_uring(scan_item_t *items, size_t item_count) {
+    uring_t ring;
+    if (uring_open(&ring, SCAN_QUEUE_DEPTH)) { return 1; }
+
+    // Files which aren't in flight are kept on a free list.
+    scan_file_t *files = malloc(SCAN_QUEUE_DEPTH * sizeof *files);
+    scan_file_t **free_files = malloc(SCAN_QUEUE_DEPTH * sizeof *free_files);
+    if (!files || !free_files) {
+        free(files);
+        free(free_files);
+        uring_close(&ring);
+        return 1;
+    }
+
+    size_t free_count = 0;
+    for (size_t i = 0; i < SCAN_QUEUE_DEPTH; i++) {
+        files[i].item = NULL;
+        files[i].fd = -1;
+        free_files[free_count++] = &files[SCAN_QUEUE_DEPTH - i - 1];
+    }
+
+    size_t next_item = 0;
+    uint8_t failed = 0;
+
+    while (!failed && (next_item < item_count || free_count < SCAN_QUEUE_DEPTH)) {
+        // Fill the queue.
+        while (free_count && next_item < item_count) {
+            scan_file_t *file = free_files[free_count - 1];
+
+            if (scan_start(file, &items[next_item++])) {
+                uring_queue_read(&ring, file);
+                free_count--;
+            } else {
+                scan_close(file);
+            }
+        }
+
+        if (free_count == SCAN_QUEUE_DEPTH) { break; }
+        if (uring_submit_and_wait(&ring)) { failed = 1; break; }
+
+        // Parse completions, queueing follow-up reads where needed.
+        unsigned head = *ring.cq_head;
+        unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            scan_file_t *file = (scan_file_t *) (uintptr_t) cqe->user_data;
+
+            ssize_t result = cqe->res;
+            if (result == -EINTR || result == -EAGAIN) {
+                uring_queue_read(&ring, file);
+            } else if (scan_complete(file, result)) {
+                uring_queue_read(&ring, file);
+            } else {
+                scan_close(file);
+                free_files[free_count++] = file;
+            }
+        }
+
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    uring_close(&ring);
+
+    // Reads still in flight when the ring failed may complete after it's
+    // closed, so their buffers can't be released. This should never happen.
+    if (free_count < SCAN_QUEUE_DEPTH) {
+        for (size_t i = 0; i < SCAN_QUEUE_DEPTH; i++) {
+            if (files[i].item) { scan_close(&files[i]); }
+        }
+    } else {
+        free(files);
+    }
+
+    free(free_files);
+    return failed;
+}
+#endif
+
+void scan_pcnt_counts(scan_item_t *items, size_t item_count) {
+    for (size_t i = 0; i < item_count; i++) {
+        items[i].count = 0;
+        items[i].status = SCAN_STATUS_FALLBACK;
+    }
+
+    if (!item_count) { return; }
+
+#ifdef HAVE_IO_URING
+    // Where io_uring is unavailable (or fails) everything is read with readv.
+    if (!scan_uring(items, item_count)) { return; }
+#endif
+
+    scan_file_t *files = malloc(SCAN_QUEUE_DEPTH * sizeof *files);
+    if (!files) { return; }
+
+    scan_readv(files, items, item_count);
+    free(files);
+}
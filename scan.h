@@ -0,0 +1,45 @@
+/* Copyright (c) 2019, Andrew Wylie. All rights reserved.   */
+/* Distributed under the terms of the 3-Clause BSD License. */
+/* Full license text available in 'LICENSE' file.           */
+#ifndef PLAYCOUNT_SCAN_H_
+#define PLAYCOUNT_SCAN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Bulk reading of ID3v2 PCNT frames, for library scans on a cold page cache.
+ *
+ * Reading tags one file at a time is dominated by per-file latency. Here the
+ * header reads for many files are issued at once (through io_uring where
+ * available, otherwise readv with posix_fadvise(WILLNEED) read-ahead), headers
+ * are parsed as reads complete, and follow-up reads are only issued for the
+ * frame headers that are needed to reach the PCNT frame. Large frames (e.g.
+ * cover art) are skipped over rather than read.
+ *
+ * Only a minimal subset of ID3v2.3/2.4 is parsed. Tags which use features
+ * outside of it (unsynchronisation, compressed PCNT frames, ...) are reported
+ * with SCAN_STATUS_FALLBACK so the caller can read them the regular way.
+ */
+typedef enum {
+    SCAN_STATUS_FALLBACK,   // The tag couldn't be read, use the regular reader.
+    SCAN_STATUS_OK          // The count was read (zero if no PCNT frame exists).
+} scan_status_t;
+
+typedef struct {
+    const char *location;   // The local file path (or 'file://' URI).
+    uintmax_t count;        // Set to the play count.
+    scan_status_t status;   // Set to the scan result.
+} scan_item_t;
+
+/**
+ * Read the PCNT frame play count of many files.
+ *
+ * Every item's status is set, even if an error occurs part way through.
+ *
+ * @param items  A pointer to the items to scan.
+ * @param item_count  The number of items.
+ */
+void scan_pcnt_counts(scan_item_t *items, size_t item_count);
+
+#endif //PLAYCOUNT_SCAN_H_